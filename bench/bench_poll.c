@@ -0,0 +1,178 @@
+/* ******************************************************
+ * @file bench_poll.c
+ * @brief encoders_poll latency under contending reader threads
+ *
+ * Build and run from the repository root, once per mode:
+ * 		cc -O2 -pthread -I. bench/bench_poll.c encoders.c ls7366r.c -o bench_poll && ./bench_poll
+ * 		cc -O2 -pthread -DENCODERS_WCET=1 -I. bench/bench_poll.c encoders.c ls7366r.c -o bench_poll && ./bench_poll
+ *
+ * Usage: bench_poll [readers] [polls] [hold_ns]
+ * Reader threads call the getters in a tight loop and keep the
+ * global lock for hold_ns each time, modelling a reader preempted
+ * while holding it. Chips are mocked at zero cost, so the numbers
+ * are the driver and lock overhead alone.
+ ********************************************************/
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "encoders.h"
+#include "test/test_mock.h"
+
+/*
+ * Global lock, readers keep it for hold_ns
+ */
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int bench_is_reader;
+static long bench_hold_ns = 2000;
+static unsigned long bench_busy;
+static unsigned long bench_waits;
+static volatile int bench_stop;
+
+static uint64_t bench_now_ns( void )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static void bench_hold( void )
+{
+	uint64_t until;
+
+	if( !bench_is_reader || bench_hold_ns <= 0 )
+		return;
+
+	until = bench_now_ns() + (uint64_t) bench_hold_ns;
+
+	while( bench_now_ns() < until )
+		;
+}
+
+void _encoders_lock_global( void )
+{
+	pthread_mutex_lock( &bench_mutex );
+	bench_waits += !bench_is_reader;
+	bench_hold();
+}
+
+void _encoders_unlock_global( void )
+{
+	pthread_mutex_unlock( &bench_mutex );
+}
+
+uint8_t _encoders_trylock_global( void )
+{
+	if( pthread_mutex_trylock( &bench_mutex ) != 0 )
+	{
+		bench_busy++;
+		return 0;
+	}
+
+	return 1;
+}
+
+static void *bench_reader( void *p_arg )
+{
+	encoders_array_degrees_t val;
+
+	(void) p_arg;
+	bench_is_reader = 1;
+
+	while( !bench_stop )
+	{
+		encoders_get_position_abs( &val );
+		encoders_get_speed( &val );
+		(void) encoders_get_faults();
+	}
+
+	return NULL;
+}
+
+static int bench_compare( const void *p_a, const void *p_b )
+{
+	uint64_t a = *(const uint64_t *) p_a;
+	uint64_t b = *(const uint64_t *) p_b;
+
+	return (a > b) - (a < b);
+}
+
+int main( int argc, char **argv )
+{
+	static const encoders_array_degrees_t degrees_per_1000_tick =
+			{ { 1, 1, 1, 1, 1, 1 } };
+	static const encoders_array_degrees_t position_ref = { { 0 } };
+	static const encoders_array_degrees_t max_speed =
+			{ { 2000, 2000, 2000, 2000, 2000, 2000 } };
+	encoders_init_t init;
+	pthread_t *p_readers;
+	uint64_t *p_latency;
+	uint64_t start;
+	long readers = 4;
+	long polls = 200000;
+	long index;
+	uint8_t counter;
+
+	if( argc > 1 )
+		readers = atol( argv[1] );
+	if( argc > 2 )
+		polls = atol( argv[2] );
+	if( argc > 3 )
+		bench_hold_ns = atol( argv[3] );
+
+	if( readers < 0 || polls <= 0 )
+	{
+		fprintf( stderr, "usage: %s [readers] [polls] [hold_ns]\n", argv[0] );
+		return 1;
+	}
+
+	p_readers = malloc( sizeof(pthread_t) * (size_t)(readers + 1) );
+	p_latency = malloc( sizeof(uint64_t) * (size_t) polls );
+
+	if( !p_readers || !p_latency )
+		return 1;
+
+	init.poll_frequency = 1000;
+	init.p_degrees_per_1000_tick = &degrees_per_1000_tick;
+	init.p_position_ref = &position_ref;
+	encoders_init( &init );
+	encoders_set_max_speed( &max_speed );
+
+	for( index = 0; index < readers; index++ )
+		pthread_create( &p_readers[index], NULL, bench_reader, NULL );
+
+	for( index = 0; index < polls; index++ )
+	{
+		for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+			mock_counter[counter] += 1000;
+
+		start = bench_now_ns();
+		encoders_poll();
+		p_latency[index] = bench_now_ns() - start;
+	}
+
+	bench_stop = 1;
+
+	for( index = 0; index < readers; index++ )
+		pthread_join( p_readers[index], NULL );
+
+	qsort( p_latency, (size_t) polls, sizeof(uint64_t), bench_compare );
+
+	printf( "mode %s, %ld readers, hold %ld ns, %ld polls\n",
+			ENCODERS_WCET ? "wcet" : "default", readers, bench_hold_ns, polls );
+	printf( "poll latency ns: p50 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+			(unsigned long long) p_latency[polls / 2],
+			(unsigned long long) p_latency[polls * 99 / 100],
+			(unsigned long long) p_latency[polls * 999 / 1000],
+			(unsigned long long) p_latency[polls - 1] );
+	printf( "dropped on busy lock: %lu, blocking locks: %lu, faults 0x%lx\n",
+			bench_busy, bench_waits, (unsigned long) encoders_get_faults() );
+
+	free( p_readers );
+	free( p_latency );
+
+	return 0;
+}
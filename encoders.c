@@ -12,6 +12,24 @@
 #include "encoders.h"
 #include "ls7366r.h"
 
+#if ENCODERS_SIMD && defined(__AVX2__)
+#define ENCODERS_SIMD_AVX2
+#include <immintrin.h>
+#elif ENCODERS_SIMD && defined(__SSE2__)
+#define ENCODERS_SIMD_SSE2
+#include <emmintrin.h>
+#elif ENCODERS_SIMD && defined(__ARM_NEON) && defined(__aarch64__)
+/* AArch32 NEON flushes denormals, so it is not bit-exact */
+#define ENCODERS_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * ticks / 1000 computed as (ticks * ENCODERS_DIV1000_MUL) >> 38,
+ * exact for every 32-bit value
+ */
+#define ENCODERS_DIV1000_MUL		(0x10624DD3u)
+
 struct {
 
 	/* polling frequency */
@@ -28,6 +46,36 @@ struct {
 
 	/* speed in degrees per second */
 	encoders_array_degrees_t speed;
+
+	/* largest tick delta accepted per poll */
+	uint32_t max_ticks_per_poll[ENCODERS_NUM_JOINTS];
+
+	/* last accepted ticks, only accessed by poll and preload */
+	uint32_t ticks_last[ENCODERS_NUM_JOINTS];
+
+	/* last accepted tick delta, only accessed by poll and preload */
+	int32_t delta_last[ENCODERS_NUM_JOINTS];
+
+	/* consecutive rejections, only accessed by poll and preload */
+	uint8_t reject_count[ENCODERS_NUM_JOINTS];
+
+	/* joints flagged with persistent glitches, held until cleared */
+	uint32_t faults;
+
+	/* joints to resynchronize after their fault was cleared */
+	uint32_t resync;
+
+	/* last accepted ticks for reads outside the lock, only accessed by poll */
+	uint32_t ticks_hint[ENCODERS_NUM_JOINTS];
+
+	/* faulted joints for reads outside the lock, only accessed by poll */
+	uint32_t faults_hint;
+
+	/* set by preload, discards the sample of the next poll */
+	uint8_t preloaded;
+
+	/* polls dropped on a busy lock, only accessed by poll */
+	uint32_t polls_missed;
 } state;
 
 const ls7366r_init_t encoder_config =
@@ -44,11 +92,119 @@ const ls7366r_init_t encoder_config =
 		LS7366R_MODE2_FLAG_NONE
 };
 
+#if ENCODERS_TRACE
+#define ENCODERS_TRACE_EVENT( event ) _encoders_trace( (event) )
+#else
+#define ENCODERS_TRACE_EVENT( event ) ((void) 0)
+#endif
+
+/*
+ * Lock wrappers with trace points
+ */
+static __inline void encoders_lock( void )
+{
+	_encoders_lock_global();
+	ENCODERS_TRACE_EVENT(ENCODERS_TRACE_LOCK_ACQUIRE);
+}
+
+static __inline void encoders_unlock( void )
+{
+	ENCODERS_TRACE_EVENT(ENCODERS_TRACE_LOCK_RELEASE);
+	_encoders_unlock_global();
+}
+
+#if ENCODERS_WCET
+static __inline uint8_t encoders_trylock( void )
+{
+	if( !_encoders_trylock_global() )
+	{
+		ENCODERS_TRACE_EVENT(ENCODERS_TRACE_LOCK_BUSY);
+		return 0;
+	}
+
+	ENCODERS_TRACE_EVENT(ENCODERS_TRACE_LOCK_ACQUIRE);
+	return 1;
+}
+#endif
+
+/*
+ * Converts raw ticks into degrees, shared by the
+ * poll path and the batch converter
+ */
+static __inline ENCODERS_DEGREE_TYPE encoders_ticks_to_degrees(
+		uint32_t ticks, ENCODERS_DEGREE_TYPE degrees_per_1000_tick )
+{
+	return ticks / 1000 * degrees_per_1000_tick;
+}
+
+/*
+ * Converts degrees into ticks, rounded to the nearest tick
+ * and saturated to the unsigned 32-bit range counters are read in
+ */
+static __inline uint32_t encoders_degrees_to_ticks(
+		ENCODERS_DEGREE_TYPE degrees, ENCODERS_DEGREE_TYPE degrees_per_1000_tick )
+{
+	ENCODERS_DEGREE_TYPE ticks;
+
+	if( degrees_per_1000_tick == 0 )
+		return 0;
+
+	ticks = degrees / degrees_per_1000_tick * 1000;
+
+	/* NaN */
+	if( ticks != ticks )
+		return 0;
+
+	ticks += (ENCODERS_DEGREE_TYPE) 0.5;
+
+	if( ticks < 0 )
+		return 0;
+
+	if( ticks >= (ENCODERS_DEGREE_TYPE) 4294967296.0 )
+		return UINT32_MAX;
+
+	return (uint32_t) ticks;
+}
+
+/*
+ * Distance between two counter readings, without branching
+ */
+static __inline uint32_t encoders_tick_distance( uint32_t a, uint32_t b )
+{
+	uint32_t delta = a - b;
+	uint32_t sign = 0u - (delta >> 31);
+
+	return (delta ^ sign) - sign;
+}
+
+/*
+ * Checks a reading against the maximum tick delta of the joint
+ * since the last accepted reading, taken the given polls ago
+ */
+static __inline uint8_t encoders_is_glitch( uint8_t joint, uint32_t ticks,
+		uint32_t periods )
+{
+	return encoders_tick_distance(ticks, state.ticks_last[joint]) >
+			(uint64_t) state.max_ticks_per_poll[joint] * periods;
+}
+
+#if !ENCODERS_WCET
+/*
+ * Same check against the copy poll keeps for reads outside
+ * the lock, only used to decide whether to re-read
+ */
+static __inline uint8_t encoders_is_hint_glitch( uint8_t joint, uint32_t ticks )
+{
+	return encoders_tick_distance(ticks, state.ticks_hint[joint]) >
+			state.max_ticks_per_poll[joint];
+}
+#endif
+
 void encoders_init( const encoders_init_t *p_init )
 {
 	uint8_t counter;
 
-	_encoders_lock_global();
+	encoders_lock();
 	state.poll_frequency = p_init->poll_frequency;
 
 	memset( &state.position_absolute, 0, sizeof(encoders_array_degrees_t) );
@@ -61,7 +217,22 @@ void encoders_init( const encoders_init_t *p_init )
 	memcpy( &state.degrees_per_1000_tick, p_init->p_degrees_per_1000_tick,
 			sizeof(encoders_array_degrees_t));
 
-	_encoders_unlock_global();
+	/* glitch rejection is off until encoders_set_max_speed */
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		state.max_ticks_per_poll[counter] = UINT32_MAX;
+
+	/* counters are cleared by ls7366r_init */
+	memset( state.ticks_last, 0, sizeof(state.ticks_last) );
+	memset( state.ticks_hint, 0, sizeof(state.ticks_hint) );
+	state.faults_hint = 0;
+	memset( state.delta_last, 0, sizeof(state.delta_last) );
+	memset( state.reject_count, 0, sizeof(state.reject_count) );
+	state.faults = 0;
+	state.resync = 0;
+	state.preloaded = 0;
+	state.polls_missed = 0;
+
+	encoders_unlock();
 
 	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
 		ls7366r_init(counter, &encoder_config);
@@ -69,43 +240,234 @@ void encoders_init( const encoders_init_t *p_init )
 
 void encoders_get_speed( encoders_array_degrees_t *p_speed )
 {
-	_encoders_lock_global();
+	encoders_lock();
 	memcpy( p_speed, &state.speed, sizeof(encoders_array_degrees_t) );
-	_encoders_unlock_global();
+	encoders_unlock();
 }
 
 void encoders_get_position_abs( encoders_array_degrees_t *p_pos )
 {
-	_encoders_lock_global();
+	encoders_lock();
 	memcpy( p_pos, &state.position_absolute, sizeof(encoders_array_degrees_t) );
-	_encoders_unlock_global();
+	encoders_unlock();
 }
 
 void encoders_get_position_rel( encoders_array_degrees_t *p_pos )
 {
 	uint8_t counter = 0;
 
-	_encoders_lock_global();
+	encoders_lock();
 	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
 	{
 		p_pos->val[counter] = state.position_absolute.val[counter] -
 				state.position_reference.val[counter];
 	}
-	_encoders_unlock_global();
+	encoders_unlock();
 }
 
 void encoders_set_position_ref( const encoders_array_degrees_t *p_ref )
 {
-	_encoders_lock_global();
+	encoders_lock();
 	memcpy( &state.position_reference, p_ref, sizeof(encoders_array_degrees_t));
-	_encoders_unlock_global();
+	encoders_unlock();
+}
+
+void encoders_set_max_speed( const encoders_array_degrees_t *p_max_speed )
+{
+	ENCODERS_DEGREE_TYPE bound;
+	uint8_t counter;
+
+	encoders_lock();
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+	{
+		state.max_ticks_per_poll[counter] = UINT32_MAX;
+
+		if( state.degrees_per_1000_tick.val[counter] == 0 )
+			continue;
+
+		bound = p_max_speed->val[counter] / state.poll_frequency * 1000 /
+				state.degrees_per_1000_tick.val[counter] *
+				ENCODERS_GLITCH_MARGIN;
+
+		if( bound < 0 )
+			bound = -bound;
+
+		/* one extra tick for quantization */
+		if( p_max_speed->val[counter] > 0 &&
+				bound < (ENCODERS_DEGREE_TYPE) UINT32_MAX )
+			state.max_ticks_per_poll[counter] = (uint32_t) bound + 1;
+	}
+	encoders_unlock();
+}
+
+void encoders_set_position_abs( const encoders_array_degrees_t *p_pos )
+{
+	uint32_t ticks[ENCODERS_NUM_JOINTS];
+	uint8_t counter;
+
+	encoders_lock();
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+	{
+		ticks[counter] = encoders_degrees_to_ticks( p_pos->val[counter],
+				state.degrees_per_1000_tick.val[counter] );
+	}
+	encoders_unlock();
+
+	/*
+	 * data registers do not affect counting, write them
+	 * without locking globals
+	 */
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		ls7366r_set_data_4b(counter, ticks[counter]);
+
+	/*
+	 * load all counters back-to-back and update the state
+	 * under the same lock so readers never see a mix of
+	 * old and new positions
+	 */
+	encoders_lock();
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		ls7366r_load_counter(counter);
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+	{
+		state.position_absolute.val[counter] = encoders_ticks_to_degrees(
+				ticks[counter], state.degrees_per_1000_tick.val[counter] );
+
+		state.ticks_last[counter] = ticks[counter];
+		state.reject_count[counter] = 0;
+	}
+
+	state.preloaded = 1;
+	encoders_unlock();
+}
+
+uint32_t encoders_get_faults( void )
+{
+	uint32_t faults;
+
+	encoders_lock();
+	faults = state.faults;
+	encoders_unlock();
+
+	return faults;
+}
+
+void encoders_clear_faults( uint32_t mask )
+{
+	encoders_lock();
+	state.resync |= state.faults & mask;
+	state.faults &= ~mask;
+	encoders_unlock();
+}
+
+/*
+ * Validates readings taken the given polls after the last accepted
+ * ones and commits them, must be called with the lock held.
+ * Returns the joints whose speed must be reported as zero.
+ */
+static uint32_t encoders_validate( uint32_t *p_ticks, uint32_t periods )
+{
+	uint32_t still = 0;
+	uint8_t counter;
+#if ENCODERS_WCET
+	uint32_t held;
+	uint32_t resync;
+	uint32_t glitch;
+	uint32_t persistent;
+	uint32_t extrapolate;
+	uint32_t keep;
+	uint32_t count;
+#else
+	uint32_t bit;
+#endif
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+	{
+#if ENCODERS_WCET
+		/*
+		 * same decisions as below, expressed as masks so that
+		 * every joint takes the same path
+		 */
+		held = (state.faults >> counter) & 1;
+		resync = (state.resync >> counter) & 1;
+		glitch = encoders_is_glitch(counter, p_ticks[counter], periods) &
+				!held & !resync;
+		count = (state.reject_count[counter] + 1) * glitch;
+		persistent = count >= ENCODERS_GLITCH_LIMIT;
+		extrapolate = 0u - (glitch & !persistent);
+		keep = 0u - (held | persistent);
+
+		p_ticks[counter] = (p_ticks[counter] & ~(extrapolate | keep)) |
+				((state.ticks_last[counter] +
+				(uint32_t) state.delta_last[counter] * periods) & extrapolate) |
+				(state.ticks_last[counter] & keep);
+
+		state.faults |= persistent << counter;
+		state.reject_count[counter] = (uint8_t)(count * !persistent);
+		still |= (held | persistent | resync) << counter;
+
+		/* kept per poll so that extrapolation can scale it */
+		state.delta_last[counter] = (int32_t)((p_ticks[counter] -
+				state.ticks_last[counter]) & (0u - !((still >> counter) & 1))) /
+				(int32_t) periods;
+#else
+		bit = (uint32_t)1 << counter;
+
+		if( state.faults & bit )
+		{
+			/* faulted, hold until cleared */
+			p_ticks[counter] = state.ticks_last[counter];
+			still |= bit;
+		}
+		else if( state.resync & bit )
+		{
+			/* fault cleared, accept the counter as is */
+			state.reject_count[counter] = 0;
+			still |= bit;
+		}
+		else if( !encoders_is_glitch(counter, p_ticks[counter], periods) )
+		{
+			state.reject_count[counter] = 0;
+		}
+		else if( ++state.reject_count[counter] < ENCODERS_GLITCH_LIMIT )
+		{
+			/* hold the last accepted speed */
+			p_ticks[counter] = state.ticks_last[counter] +
+					(uint32_t) state.delta_last[counter];
+		}
+		else
+		{
+			/* persistent, flag and hold */
+			state.faults |= bit;
+			state.reject_count[counter] = 0;
+			p_ticks[counter] = state.ticks_last[counter];
+			still |= bit;
+		}
+
+		state.delta_last[counter] = (still & bit) ? 0 :
+				(int32_t)(p_ticks[counter] - state.ticks_last[counter]);
+#endif
+
+		state.ticks_last[counter] = p_ticks[counter];
+	}
+
+	state.resync = 0;
+
+	return still;
 }
 
 void encoders_poll(void)
 {
 	ENCODERS_DEGREE_TYPE temp;
+	ENCODERS_FREQUENCY_TYPE frequency;
 	uint32_t ticks[ENCODERS_NUM_JOINTS];
+	uint32_t periods;
+	uint32_t still;
 	uint8_t counter;
+#if !ENCODERS_WCET
+	uint8_t retry;
+#endif
 
 	/*
 	 * read-in raw ticks first, buffer locally without
@@ -117,17 +479,245 @@ void encoders_poll(void)
 		ticks[counter] = ls7366r_get_counter_4b(counter);
 	}
 
-	_encoders_lock_global();
+#if !ENCODERS_WCET
+	/*
+	 * re-read only the joints that moved faster than
+	 * physically possible, a single corrupted transfer
+	 * then costs one extra read instead of a full second pass.
+	 * Faulted joints are held anyway and are not re-read.
+	 */
 	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
 	{
-		temp = ticks[counter] / 1000 * state.degrees_per_1000_tick.val[counter];
+		if( (state.faults_hint >> counter) & 1 )
+			continue;
 
-		state.speed.val[counter] = (temp - state.position_absolute.val[counter]) *
-				state.poll_frequency;
+		for( retry = 0; retry < ENCODERS_GLITCH_RETRIES &&
+				encoders_is_hint_glitch(counter, ticks[counter]); retry++ )
+		{
+			ticks[counter] = ls7366r_get_counter_4b(counter);
+		}
+	}
+#endif
 
-		state.position_absolute.val[counter] = temp;
+#if ENCODERS_WCET
+	if( state.polls_missed >= ENCODERS_WCET_MAX_MISSED )
+	{
+		/* snapshot is as stale as allowed, wait for the lock */
+		encoders_lock();
+	}
+	else if( !encoders_trylock() )
+	{
+		/* keep the previous snapshot instead of blocking */
+		state.polls_missed++;
+		return;
+	}
+
+	periods = state.polls_missed + 1;
+	frequency = state.poll_frequency / (ENCODERS_FREQUENCY_TYPE) periods;
+	state.polls_missed = 0;
+#else
+	encoders_lock();
+	periods = 1;
+	frequency = state.poll_frequency;
+#endif
+
+	if( state.preloaded )
+	{
+		/* counters may have been reloaded after they were read */
+		state.preloaded = 0;
+	}
+	else
+	{
+		still = encoders_validate( ticks, periods );
+
+		for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		{
+			temp = encoders_ticks_to_degrees( ticks[counter],
+					state.degrees_per_1000_tick.val[counter] );
+
+			/* zero for held and resynchronized joints, without branching */
+			state.speed.val[counter] = (temp - state.position_absolute.val[counter]) *
+					frequency * (ENCODERS_FREQUENCY_TYPE) !((still >> counter) & 1);
+
+			state.position_absolute.val[counter] = temp;
+		}
+	}
+
+	memcpy( state.ticks_hint, state.ticks_last, sizeof(state.ticks_hint) );
+	state.faults_hint = state.faults | state.resync;
+	encoders_unlock();
+}
+
+#if defined(ENCODERS_SIMD_AVX2) || defined(ENCODERS_SIMD_SSE2) || \
+	defined(ENCODERS_SIMD_NEON)
+typedef char encoders_simd_requires_float[
+		(sizeof(ENCODERS_DEGREE_TYPE) == sizeof(float) &&
+		sizeof(ENCODERS_FREQUENCY_TYPE) == sizeof(float)) ? 1 : -1 ];
+#endif
+
+/*
+ * Converts ticks into positions with intrinsics,
+ * returns the number of samples converted
+ */
+static __inline uint32_t encoders_convert_positions_simd(
+		const uint32_t *p_ticks, ENCODERS_DEGREE_TYPE *p_pos,
+		uint32_t num_samples, ENCODERS_DEGREE_TYPE degrees_per_1000_tick )
+{
+	uint32_t sample = 0;
+
+#if defined(ENCODERS_SIMD_AVX2)
+	const __m256i mul = _mm256_set1_epi32((int) ENCODERS_DIV1000_MUL);
+	const __m256 scale = _mm256_set1_ps(degrees_per_1000_tick);
+
+	for( ; sample + 8 <= num_samples; sample += 8 )
+	{
+		__m256i ticks = _mm256_loadu_si256((const __m256i *)(p_ticks + sample));
+
+		/* 32x32->64 multiply on even and odd lanes */
+		__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(ticks, mul), 38);
+		__m256i odd = _mm256_srli_epi64(
+				_mm256_mul_epu32(_mm256_srli_epi64(ticks, 32), mul), 38);
+		__m256i quot = _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+
+		/* quotient is below 2^23, signed conversion is exact */
+		_mm256_storeu_ps(p_pos + sample,
+				_mm256_mul_ps(_mm256_cvtepi32_ps(quot), scale));
+	}
+#elif defined(ENCODERS_SIMD_SSE2)
+	const __m128i mul = _mm_set1_epi32((int) ENCODERS_DIV1000_MUL);
+	const __m128 scale = _mm_set1_ps(degrees_per_1000_tick);
+
+	for( ; sample + 4 <= num_samples; sample += 4 )
+	{
+		__m128i ticks = _mm_loadu_si128((const __m128i *)(p_ticks + sample));
+
+		/* 32x32->64 multiply on even and odd lanes */
+		__m128i even = _mm_srli_epi64(_mm_mul_epu32(ticks, mul), 38);
+		__m128i odd = _mm_srli_epi64(
+				_mm_mul_epu32(_mm_srli_epi64(ticks, 32), mul), 38);
+		__m128i quot = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+
+		/* quotient is below 2^23, signed conversion is exact */
+		_mm_storeu_ps(p_pos + sample,
+				_mm_mul_ps(_mm_cvtepi32_ps(quot), scale));
+	}
+#elif defined(ENCODERS_SIMD_NEON)
+	const uint32x2_t mul = vdup_n_u32(ENCODERS_DIV1000_MUL);
+	const float32x4_t scale = vdupq_n_f32(degrees_per_1000_tick);
+
+	for( ; sample + 4 <= num_samples; sample += 4 )
+	{
+		uint32x4_t ticks = vld1q_u32(p_ticks + sample);
+		uint32x4_t quot = vcombine_u32(
+				vshrn_n_u64(vmull_u32(vget_low_u32(ticks), mul), 32),
+				vshrn_n_u64(vmull_u32(vget_high_u32(ticks), mul), 32));
+
+		quot = vshrq_n_u32(quot, 6);
+
+		vst1q_f32(p_pos + sample, vmulq_f32(vcvtq_f32_u32(quot), scale));
+	}
+#else
+	(void) p_ticks;
+	(void) p_pos;
+	(void) num_samples;
+	(void) degrees_per_1000_tick;
+#endif
+
+	return sample;
+}
+
+/*
+ * Computes speeds from consecutive positions with intrinsics,
+ * starting at sample 1, returns the next sample to compute
+ */
+static __inline uint32_t encoders_convert_speeds_simd(
+		const ENCODERS_DEGREE_TYPE *p_pos, ENCODERS_DEGREE_TYPE *p_speed,
+		uint32_t num_samples, ENCODERS_FREQUENCY_TYPE poll_frequency )
+{
+	uint32_t sample = 1;
+
+#if defined(ENCODERS_SIMD_AVX2)
+	const __m256 freq = _mm256_set1_ps(poll_frequency);
+
+	for( ; sample + 8 <= num_samples; sample += 8 )
+	{
+		_mm256_storeu_ps(p_speed + sample, _mm256_mul_ps(
+				_mm256_sub_ps(_mm256_loadu_ps(p_pos + sample),
+				_mm256_loadu_ps(p_pos + sample - 1)), freq));
+	}
+#elif defined(ENCODERS_SIMD_SSE2)
+	const __m128 freq = _mm_set1_ps(poll_frequency);
+
+	for( ; sample + 4 <= num_samples; sample += 4 )
+	{
+		_mm_storeu_ps(p_speed + sample, _mm_mul_ps(
+				_mm_sub_ps(_mm_loadu_ps(p_pos + sample),
+				_mm_loadu_ps(p_pos + sample - 1)), freq));
+	}
+#elif defined(ENCODERS_SIMD_NEON)
+	const float32x4_t freq = vdupq_n_f32(poll_frequency);
+
+	for( ; sample + 4 <= num_samples; sample += 4 )
+	{
+		vst1q_f32(p_speed + sample, vmulq_f32(
+				vsubq_f32(vld1q_f32(p_pos + sample),
+				vld1q_f32(p_pos + sample - 1)), freq));
+	}
+#else
+	(void) p_pos;
+	(void) p_speed;
+	(void) num_samples;
+	(void) poll_frequency;
+#endif
+
+	return sample;
+}
+
+void encoders_convert( const uint32_t *ENCODERS_RESTRICT p_ticks,
+		ENCODERS_DEGREE_TYPE *ENCODERS_RESTRICT p_pos,
+		ENCODERS_DEGREE_TYPE *ENCODERS_RESTRICT p_speed,
+		uint32_t num_samples,
+		const encoders_array_degrees_t *p_degrees_per_1000_tick,
+		const encoders_array_degrees_t *p_position_prev,
+		ENCODERS_FREQUENCY_TYPE poll_frequency )
+{
+	ENCODERS_DEGREE_TYPE degrees_per_1000_tick;
+	uint32_t sample;
+	uint8_t counter;
+
+	if( num_samples == 0 )
+		return;
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+	{
+		degrees_per_1000_tick = p_degrees_per_1000_tick->val[counter];
+
+		/* scalar loops finish the samples left by the intrinsics */
+		sample = encoders_convert_positions_simd( p_ticks, p_pos,
+				num_samples, degrees_per_1000_tick );
+
+		for( ; sample < num_samples; sample++ )
+		{
+			p_pos[sample] = encoders_ticks_to_degrees( p_ticks[sample],
+					degrees_per_1000_tick );
+		}
+
+		p_speed[0] = (p_pos[0] - p_position_prev->val[counter]) *
+				poll_frequency;
+
+		sample = encoders_convert_speeds_simd( p_pos, p_speed,
+				num_samples, poll_frequency );
+
+		for( ; sample < num_samples; sample++ )
+		{
+			p_speed[sample] = (p_pos[sample] - p_pos[sample - 1]) *
+					poll_frequency;
+		}
+
+		p_ticks += num_samples;
+		p_pos += num_samples;
+		p_speed += num_samples;
 	}
-	_encoders_unlock_global();
 }
 
 /*
@@ -144,3 +734,16 @@ void _encoders_unlock_global( void )
 {
 	return;
 }
+
+__attribute__((weak))
+uint8_t _encoders_trylock_global( void )
+{
+	_encoders_lock_global();
+	return 1;
+}
+
+__attribute__((weak))
+void _encoders_trace( uint8_t event )
+{
+	(void) event;
+}
@@ -25,6 +25,96 @@
 #define ENCODERS_DEGREE_TYPE 		float
 #define ENCODERS_FREQUENCY_TYPE 	float
 
+/*
+ * restrict qualifier, empty where the compiler does not support it
+ */
+#if defined(__cplusplus) || !defined(__STDC_VERSION__) || \
+	(__STDC_VERSION__ < 199901L)
+#define ENCODERS_RESTRICT
+#else
+#define ENCODERS_RESTRICT			restrict
+#endif
+
+/*
+ * Batch conversion
+ *
+ * Set to 1 to let encoders_convert use SSE2, AVX2 or AArch64 NEON
+ * intrinsics when the compiler targets them, for example with -mavx2.
+ * SSE2 is the default on x86-64. Requires float degree and frequency
+ * types. Without intrinsics, a scalar loop is used, which compilers
+ * only vectorize at -O3 with a SIMD capable -march.
+ */
+#ifndef ENCODERS_SIMD
+#define ENCODERS_SIMD				(1)
+#endif
+
+/*
+ * Glitch rejection
+ *
+ * A joint whose tick delta exceeds the bound given by its maximum
+ * speed, set with encoders_set_max_speed, is re-read up to
+ * ENCODERS_GLITCH_RETRIES times within the same poll. A reading that
+ * is still out of bounds is replaced by an extrapolation of the last
+ * accepted delta. After
+ * ENCODERS_GLITCH_LIMIT consecutive rejections the joint is flagged
+ * as faulty and holds its last accepted position at zero speed until
+ * the fault is cleared, after which it is resynchronized to its
+ * counter. ENCODERS_GLITCH_MARGIN is the headroom applied to the
+ * maximum speed to absorb quantization and poll jitter.
+ */
+#ifndef ENCODERS_GLITCH_RETRIES
+#define ENCODERS_GLITCH_RETRIES		(1)
+#endif
+
+#ifndef ENCODERS_GLITCH_LIMIT
+#define ENCODERS_GLITCH_LIMIT		(3)
+#endif
+
+#ifndef ENCODERS_GLITCH_MARGIN
+#define ENCODERS_GLITCH_MARGIN		(1.25f)
+#endif
+
+/*
+ * Worst-case execution time mode
+ *
+ * Set to 1 to bound the execution time of encoders_poll. Glitched
+ * joints are not re-read, glitch handling uses no data-dependent
+ * branches, and the global lock is taken with
+ * _encoders_trylock_global. If the lock is busy, the sample is
+ * dropped before any glitch state is touched and readers keep the
+ * previous snapshot. The next poll scales the speed, the glitch
+ * bound and the extrapolation by the number of elapsed polls.
+ *
+ * At most ENCODERS_WCET_MAX_MISSED consecutive polls are dropped.
+ * The poll after them waits on _encoders_lock_global, so the snapshot
+ * is never older than ENCODERS_WCET_MAX_MISSED + 1 poll periods, and
+ * the execution time of that poll includes the longest section any
+ * other context holds the global lock for.
+ */
+#ifndef ENCODERS_WCET
+#define ENCODERS_WCET				(0)
+#endif
+
+#ifndef ENCODERS_WCET_MAX_MISSED
+#define ENCODERS_WCET_MAX_MISSED	(4)
+#endif
+
+/*
+ * Trace hooks
+ *
+ * Set to 1 to call _encoders_trace when the global lock is acquired,
+ * released, or found busy in ENCODERS_WCET mode. See trace/ for a
+ * reference implementation.
+ */
+#ifndef ENCODERS_TRACE
+#define ENCODERS_TRACE				(0)
+#endif
+
+/* trace events */
+#define ENCODERS_TRACE_LOCK_ACQUIRE	(0)
+#define ENCODERS_TRACE_LOCK_RELEASE	(1)
+#define ENCODERS_TRACE_LOCK_BUSY	(2)
+
 /*
  * Array of encoder degrees
  */
@@ -45,11 +135,24 @@ typedef struct {
 
 /*
  * Define these functions to replace the dummy
- * provided with this library.
+ * provided with this library. The bus lock of
+ * ls7366r.h may be taken while the global lock
+ * is held, never the other way around.
  */
 void _encoders_lock_global( void );
 void _encoders_unlock_global( void );
 
+/*
+ * Returns non-zero if the lock was acquired.
+ * The dummy falls back to _encoders_lock_global.
+ */
+uint8_t _encoders_trylock_global( void );
+
+/*
+ * Called only if ENCODERS_TRACE is set
+ */
+void _encoders_trace( uint8_t event );
+
 /**
  * @brief Initializes encoder interfaces
  * @param p_init pointer to initialization routines
@@ -90,13 +193,86 @@ void encoders_get_position_rel( encoders_array_degrees_t *p_pos );
  */
 void encoders_set_position_ref( const encoders_array_degrees_t *p_ref );
 
+/**
+ * @brief Sets the maximum physical speed of each joint
+ * @param p_max_speed maximum speed in degrees per second for each joint
+ * @return none
+ * @details Enables glitch rejection, which @ref encoders_init
+ * disables. The bound is scaled by ENCODERS_GLITCH_MARGIN plus one
+ * tick of headroom. A non-positive speed disables glitch rejection
+ * for that joint. Call after @ref encoders_init.
+ * @note This function is thread safe.
+ */
+void encoders_set_max_speed( const encoders_array_degrees_t *p_max_speed );
+
+/**
+ * @brief Preloads the counters of all joints
+ * @param p_pos absolute position to load for each joint
+ * @return none
+ * @details Writes the data register of every joint first, then
+ * loads all counters back-to-back to minimize inter-joint skew.
+ * Positions are rounded to the nearest tick and saturated to the
+ * unsigned 32-bit range the counters are read in, so negative
+ * positions load as zero. The absolute position reported afterwards
+ * is the loaded value rounded down to the 1000 tick resolution used
+ * by @ref encoders_poll. The next @ref encoders_poll to take the
+ * lock discards its sample, since it may have been read before the
+ * load.
+ * @note This function is thread safe if _ls7366r_bus_lock and
+ * _ls7366r_bus_unlock serialize the bus, otherwise it must run in the
+ * same context as @ref encoders_poll.
+ */
+void encoders_set_position_abs( const encoders_array_degrees_t *p_pos );
+
+/**
+ * @brief Obtains joints flagged with persistent glitches
+ * @return bitmask, bit n is set if joint n has been flagged
+ * @note This function is thread safe.
+ */
+uint32_t encoders_get_faults( void );
+
+/**
+ * @brief Clears glitch fault flags
+ * @param mask bitmask of joints to clear
+ * @return none
+ * @details Cleared joints are resynchronized to their counter on the
+ * next poll, with zero speed reported for that poll.
+ * @note This function is thread safe.
+ */
+void encoders_clear_faults( uint32_t mask );
+
 /**
  * @brief Polls the encoder
  * @return none
  * @details Must be called periodically with the
- * frequency specified in the config to work properly
+ * frequency specified in the config to work properly.
+ * See ENCODERS_WCET for bounded execution time.
  * @note This function is thread-safe.
  */
 void encoders_poll(void);
 
+/**
+ * @brief Converts a batch of raw ticks into position and speed
+ * @param p_ticks raw ticks, joint-major, num_samples per joint
+ * @param p_pos writable positions, same layout as p_ticks
+ * @param p_speed writable speeds, same layout as p_ticks
+ * @param num_samples number of consecutive samples per joint
+ * @param p_degrees_per_1000_tick degrees per 1000 tick for each joint
+ * @param p_position_prev position of each joint before the first sample
+ * @param poll_frequency sampling frequency in Hz
+ * @return none
+ * @details Sample s of joint j is at index j * num_samples + s.
+ * Produces bit-identical results to the formula in @ref encoders_poll.
+ * See ENCODERS_SIMD for the vectorized paths. Output arrays must not
+ * overlap the inputs.
+ * @note This function does not access the driver state.
+ */
+void encoders_convert( const uint32_t *ENCODERS_RESTRICT p_ticks,
+		ENCODERS_DEGREE_TYPE *ENCODERS_RESTRICT p_pos,
+		ENCODERS_DEGREE_TYPE *ENCODERS_RESTRICT p_speed,
+		uint32_t num_samples,
+		const encoders_array_degrees_t *p_degrees_per_1000_tick,
+		const encoders_array_degrees_t *p_position_prev,
+		ENCODERS_FREQUENCY_TYPE poll_frequency );
+
 #endif /* H432AD0B7_77AE_494F_92B0_A8D8E4687562 */
@@ -30,5 +30,22 @@ uint8_t _ls7366r_spi_transfer( uint8_t chip_sel, uint8_t out )
 	return 0;
 }
 
+__attribute__((weak))
+void _ls7366r_trace( uint8_t event, uint8_t chip_sel, uint8_t arg )
+{
+	(void) event;
+	(void) chip_sel;
+	(void) arg;
+}
 
+__attribute__((weak))
+void _ls7366r_bus_lock( uint8_t chip_sel )
+{
+	(void) chip_sel;
+}
 
+__attribute__((weak))
+void _ls7366r_bus_unlock( uint8_t chip_sel )
+{
+	(void) chip_sel;
+}
@@ -114,6 +114,25 @@
 #define LS7366R_STATUS_IS_COUNT_UP         (1 << 1) /* set if count up        */
 #define LS7366R_STATUS_IS_NEGATIVE         (1 << 0) /* set if negative        */
 
+/*
+ * Trace hooks
+ *
+ * Set to 1 to call _ls7366r_trace before chip select, after chip
+ * select, after every byte transferred and after chip deselect,
+ * which ends the transaction. The hook is expected to timestamp the
+ * event into a buffer, not to print. See trace/ for a reference
+ * implementation.
+ */
+#ifndef LS7366R_TRACE
+#define LS7366R_TRACE                  (0)
+#endif
+
+/* trace events */
+#define LS7366R_TRACE_BEGIN            (0) /* transaction begin, arg is command */
+#define LS7366R_TRACE_CHIP_SEL         (1) /* chip selected, arg is command     */
+#define LS7366R_TRACE_TRANSFER         (2) /* byte transferred, arg is received */
+#define LS7366R_TRACE_CHIP_DESEL       (3) /* chip deselected, transaction end  */
+
 /*
  * Initialization configuration for a single encoder
  */
@@ -129,6 +148,15 @@ typedef struct {
 void _ls7366r_chip_sel( uint8_t chip_sel );
 void _ls7366r_chip_desel( uint8_t chip_sel );
 uint8_t _ls7366r_spi_transfer( uint8_t chip_sel, uint8_t out );
+void _ls7366r_trace( uint8_t event, uint8_t chip_sel, uint8_t arg );
+
+/*
+ * Held for a whole transaction, from before chip select to after
+ * chip deselect. Define these to serialize transactions when chips
+ * share a bus and are accessed from more than one context.
+ */
+void _ls7366r_bus_lock( uint8_t chip_sel );
+void _ls7366r_bus_unlock( uint8_t chip_sel );
 
 #define _LS7366R_CMD_CLEAR_MDR0        (0x08) /* clear mode register 0        */
 #define _LS7366R_CMD_CLEAR_MDR1        (0x10) /* clear mode register 1        */
@@ -148,9 +176,20 @@ uint8_t _ls7366r_spi_transfer( uint8_t chip_sel, uint8_t out );
 #define _LS7366R_CMD_LOAD_DTR_CNTR     (0xE0) /* load data register -> data   */
 #define _LS7366R_CMD_LOAD_CNTR_OTR     (0xE8) /* load data -> output register */
 
+#if LS7366R_TRACE
+#define _LS7366R_TRACE( event, chip_sel, arg ) \
+	_ls7366r_trace( (event), (chip_sel), (arg) )
+#else
+#define _LS7366R_TRACE( event, chip_sel, arg ) ((void) 0)
+#endif
+
 /*
  * Function prototypes
  */
+static __inline void      _ls7366r_transaction_begin( uint8_t chip_sel, uint8_t cmd );
+static __inline uint8_t   _ls7366r_transfer( uint8_t chip_sel, uint8_t out );
+static __inline void      _ls7366r_transaction_end( uint8_t chip_sel );
+
 static __inline void      ls7366r_init( uint8_t chip_sel, const ls7366r_init_t *p_init);
 
 static __inline uint8_t   ls7366r_get_status( uint8_t chip_sel );
@@ -178,6 +217,35 @@ static __inline uint32_t  ls7366r_get_last_counter_4b( uint8_t chip_sel );
  * Function definitions
  */
 
+/*
+ * Locks the bus, selects the chip and sends the command byte
+ */
+static __inline void _ls7366r_transaction_begin( uint8_t chip_sel, uint8_t cmd ) {
+	_LS7366R_TRACE(LS7366R_TRACE_BEGIN, chip_sel, cmd);
+	_ls7366r_bus_lock(chip_sel);
+	_ls7366r_chip_sel(chip_sel);
+	_LS7366R_TRACE(LS7366R_TRACE_CHIP_SEL, chip_sel, cmd);
+	_ls7366r_transfer(chip_sel, cmd);
+}
+
+/*
+ * Transfers a byte within a transaction
+ */
+static __inline uint8_t _ls7366r_transfer( uint8_t chip_sel, uint8_t out ) {
+	uint8_t ret = _ls7366r_spi_transfer(chip_sel, out);
+	_LS7366R_TRACE(LS7366R_TRACE_TRANSFER, chip_sel, ret);
+	return ret;
+}
+
+/*
+ * Deselects the chip and unlocks the bus
+ */
+static __inline void _ls7366r_transaction_end( uint8_t chip_sel ) {
+	_ls7366r_chip_desel(chip_sel);
+	_LS7366R_TRACE(LS7366R_TRACE_CHIP_DESEL, chip_sel, 0);
+	_ls7366r_bus_unlock(chip_sel);
+}
+
 /**
  * @brief Initializes a ls7366r
  * @param chip_sel chip selection
@@ -186,16 +254,14 @@ static __inline uint32_t  ls7366r_get_last_counter_4b( uint8_t chip_sel );
  */
 static __inline void ls7366r_init( uint8_t chip_sel, const ls7366r_init_t *p_init) {
 	/* write mode 0 */
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_WRITE_MDR0);
-	_ls7366r_spi_transfer(chip_sel, p_init->mode1);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_WRITE_MDR0);
+	_ls7366r_transfer(chip_sel, p_init->mode1);
+	_ls7366r_transaction_end(chip_sel);
 
 	/* write mode 1 */
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_WRITE_MDR1);
-	_ls7366r_spi_transfer(chip_sel, p_init->mode2);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_WRITE_MDR1);
+	_ls7366r_transfer(chip_sel, p_init->mode2);
+	_ls7366r_transaction_end(chip_sel);
 
 	/* clear counter register */
 	ls7366r_clear_counter(chip_sel);
@@ -215,10 +281,9 @@ static __inline void ls7366r_init( uint8_t chip_sel, const ls7366r_init_t *p_ini
  */
 static __inline uint8_t ls7366r_get_status( uint8_t chip_sel ) {
 	uint8_t ret;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_STR );
-	ret = _ls7366r_spi_transfer( chip_sel, 0x00 ); /* send dummy value */
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_STR);
+	ret = _ls7366r_transfer( chip_sel, 0x00 ); /* send dummy value */
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -228,9 +293,8 @@ static __inline uint8_t ls7366r_get_status( uint8_t chip_sel ) {
  * @return none
  */
 static __inline void ls7366r_clear_status( uint8_t chip_sel ) {
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_CLEAR_STR);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_CLEAR_STR);
+	_ls7366r_transaction_end(chip_sel);
 }
 
 /**
@@ -239,9 +303,8 @@ static __inline void ls7366r_clear_status( uint8_t chip_sel ) {
  * @return none
  */
 static __inline void ls7366r_clear_counter( uint8_t chip_sel ) {
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_CLEAR_CNTR);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_CLEAR_CNTR);
+	_ls7366r_transaction_end(chip_sel);
 }
 
 /**
@@ -254,9 +317,8 @@ static __inline void ls7366r_clear_counter( uint8_t chip_sel ) {
  * to load the value from the data register to the counter.
  */
 static __inline void ls7366r_load_counter(uint8_t chip_sel) {
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_LOAD_DTR_CNTR);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_LOAD_DTR_CNTR);
+	_ls7366r_transaction_end(chip_sel);
 }
 
 /**
@@ -269,10 +331,9 @@ static __inline void ls7366r_load_counter(uint8_t chip_sel) {
  * This function is used when the counter is configured as 1 byte.
  */
 static __inline void ls7366r_set_data_1b(uint8_t chip_sel, uint8_t val) {
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_WRITE_DTR);
-	_ls7366r_spi_transfer(chip_sel, val);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_WRITE_DTR);
+	_ls7366r_transfer(chip_sel, val);
+	_ls7366r_transaction_end(chip_sel);
 }
 
 /**
@@ -285,11 +346,10 @@ static __inline void ls7366r_set_data_1b(uint8_t chip_sel, uint8_t val) {
  * This function is used when the counter is configured as 2 bytes.
  */
 static __inline void ls7366r_set_data_2b(uint8_t chip_sel, uint16_t val) {
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_WRITE_DTR);
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val >> 8) );
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val & 0xFF) );
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_WRITE_DTR);
+	_ls7366r_transfer(chip_sel, (uint8_t)(val >> 8) );
+	_ls7366r_transfer(chip_sel, (uint8_t)(val & 0xFF) );
+	_ls7366r_transaction_end(chip_sel);
 }
 
 /**
@@ -302,12 +362,11 @@ static __inline void ls7366r_set_data_2b(uint8_t chip_sel, uint16_t val) {
  * This function is used when the counter is configured as 3 bytes.
  */
 static __inline void ls7366r_set_data_3b(uint8_t chip_sel, uint32_t val) {
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_WRITE_DTR);
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val >> 16) );
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val >> 8) );
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val & 0xFF) );
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_WRITE_DTR);
+	_ls7366r_transfer(chip_sel, (uint8_t)(val >> 16) );
+	_ls7366r_transfer(chip_sel, (uint8_t)(val >> 8) );
+	_ls7366r_transfer(chip_sel, (uint8_t)(val & 0xFF) );
+	_ls7366r_transaction_end(chip_sel);
 }
 
 /**
@@ -320,13 +379,12 @@ static __inline void ls7366r_set_data_3b(uint8_t chip_sel, uint32_t val) {
  * This function is used when the counter is configured as 4 bytes.
  */
 static __inline void ls7366r_set_data_4b(uint8_t chip_sel, uint32_t val) {
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_WRITE_DTR);
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val >> 24) );
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val >> 16) );
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val >> 8) );
-	_ls7366r_spi_transfer(chip_sel, (uint8_t)(val & 0xFF) );
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_WRITE_DTR);
+	_ls7366r_transfer(chip_sel, (uint8_t)(val >> 24) );
+	_ls7366r_transfer(chip_sel, (uint8_t)(val >> 16) );
+	_ls7366r_transfer(chip_sel, (uint8_t)(val >> 8) );
+	_ls7366r_transfer(chip_sel, (uint8_t)(val & 0xFF) );
+	_ls7366r_transaction_end(chip_sel);
 }
 
 /**
@@ -339,10 +397,9 @@ static __inline void ls7366r_set_data_4b(uint8_t chip_sel, uint32_t val) {
  */
 static __inline uint8_t ls7366r_get_counter_1b(uint8_t chip_sel) {
 	uint8_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
-	ret = _ls7366r_spi_transfer(chip_sel, 0x00); /* send dummy value */
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
+	ret = _ls7366r_transfer(chip_sel, 0x00); /* send dummy value */
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -356,11 +413,10 @@ static __inline uint8_t ls7366r_get_counter_1b(uint8_t chip_sel) {
  */
 static __inline uint16_t ls7366r_get_counter_2b(uint8_t chip_sel) {
 	uint16_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
-	ret |= (uint16_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 8;
-	ret |= _ls7366r_spi_transfer(chip_sel, 0x00);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
+	ret |= (uint16_t)_ls7366r_transfer(chip_sel, 0x00) << 8;
+	ret |= _ls7366r_transfer(chip_sel, 0x00);
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -374,12 +430,11 @@ static __inline uint16_t ls7366r_get_counter_2b(uint8_t chip_sel) {
  */
 static __inline uint32_t ls7366r_get_counter_3b(uint8_t chip_sel) {
 	uint32_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 16;
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 8;
-	ret |= _ls7366r_spi_transfer(chip_sel, 0x00);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 16;
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 8;
+	ret |= _ls7366r_transfer(chip_sel, 0x00);
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -393,13 +448,12 @@ static __inline uint32_t ls7366r_get_counter_3b(uint8_t chip_sel) {
  */
 static __inline uint32_t ls7366r_get_counter_4b(uint8_t chip_sel) {
 	uint32_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 24;
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 16;
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 8;
-	ret |= _ls7366r_spi_transfer(chip_sel, 0x00);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_CNTR_OTR);
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 24;
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 16;
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 8;
+	ret |= _ls7366r_transfer(chip_sel, 0x00);
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -412,10 +466,9 @@ static __inline uint32_t ls7366r_get_counter_4b(uint8_t chip_sel) {
  */
 static __inline uint8_t ls7366r_get_last_counter_1b(uint8_t chip_sel) {
 	uint8_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_OTR);
-	ret = _ls7366r_spi_transfer(chip_sel, 0x00); /* send dummy value */
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_OTR);
+	ret = _ls7366r_transfer(chip_sel, 0x00); /* send dummy value */
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -428,11 +481,10 @@ static __inline uint8_t ls7366r_get_last_counter_1b(uint8_t chip_sel) {
  */
 static __inline uint16_t ls7366r_get_last_counter_2b(uint8_t chip_sel) {
 	uint16_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_OTR);
-	ret |= (uint16_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 8;
-	ret |= _ls7366r_spi_transfer(chip_sel, 0x00);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_OTR);
+	ret |= (uint16_t)_ls7366r_transfer(chip_sel, 0x00) << 8;
+	ret |= _ls7366r_transfer(chip_sel, 0x00);
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -445,12 +497,11 @@ static __inline uint16_t ls7366r_get_last_counter_2b(uint8_t chip_sel) {
  */
 static __inline uint32_t ls7366r_get_last_counter_3b(uint8_t chip_sel) {
 	uint32_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_OTR);
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 16;
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 8;
-	ret |= _ls7366r_spi_transfer(chip_sel, 0x00);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_OTR);
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 16;
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 8;
+	ret |= _ls7366r_transfer(chip_sel, 0x00);
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
@@ -463,13 +514,12 @@ static __inline uint32_t ls7366r_get_last_counter_3b(uint8_t chip_sel) {
  */
 static __inline uint32_t ls7366r_get_last_counter_4b(uint8_t chip_sel) {
 	uint32_t ret = 0;
-	_ls7366r_chip_sel(chip_sel);
-	_ls7366r_spi_transfer(chip_sel, _LS7366R_CMD_READ_OTR);
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 24;
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 16;
-	ret |= (uint32_t)_ls7366r_spi_transfer(chip_sel, 0x00) << 8;
-	ret |= _ls7366r_spi_transfer(chip_sel, 0x00);
-	_ls7366r_chip_desel(chip_sel);
+	_ls7366r_transaction_begin(chip_sel, _LS7366R_CMD_READ_OTR);
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 24;
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 16;
+	ret |= (uint32_t)_ls7366r_transfer(chip_sel, 0x00) << 8;
+	ret |= _ls7366r_transfer(chip_sel, 0x00);
+	_ls7366r_transaction_end(chip_sel);
 	return ret;
 }
 
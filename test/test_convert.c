@@ -0,0 +1,117 @@
+/* ******************************************************
+ * @file test_convert.c
+ * @brief Cross-checks encoders_convert against the poll formula
+ *
+ * Build and run from the repository root, once per path:
+ * 		cc -O2 -Wall -I. test/test_convert.c encoders.c ls7366r.c -o test_convert && ./test_convert
+ * 		cc -O2 -Wall -mavx2 -I. test/test_convert.c encoders.c ls7366r.c -o test_convert && ./test_convert
+ * 		cc -O2 -Wall -DENCODERS_SIMD=0 -I. test/test_convert.c encoders.c ls7366r.c -o test_convert && ./test_convert
+ ********************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "encoders.h"
+
+#define TEST_MAX_SAMPLES (1037)
+
+static uint32_t ticks[ENCODERS_NUM_JOINTS * TEST_MAX_SAMPLES];
+static ENCODERS_DEGREE_TYPE pos[ENCODERS_NUM_JOINTS * TEST_MAX_SAMPLES];
+static ENCODERS_DEGREE_TYPE speed[ENCODERS_NUM_JOINTS * TEST_MAX_SAMPLES];
+
+static const uint32_t edges[] = {
+		0, 1, 999, 1000, 1001, 1999, 2000, 999999, 1000000,
+		0x7FFFFFFFu, 0x80000000u, 0xFFFFFC17u, 0xFFFFFFFEu, 0xFFFFFFFFu
+};
+
+/* xorshift, deterministic across hosts */
+static uint32_t test_random( void )
+{
+	static uint32_t seed = 2463534242u;
+
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+/* formula used by encoders_poll */
+static ENCODERS_DEGREE_TYPE test_reference( uint32_t ticks_in,
+		ENCODERS_DEGREE_TYPE degrees_per_1000_tick )
+{
+	return ticks_in / 1000 * degrees_per_1000_tick;
+}
+
+static unsigned test_batch( uint32_t num_samples,
+		const encoders_array_degrees_t *p_degrees_per_1000_tick,
+		const encoders_array_degrees_t *p_position_prev,
+		ENCODERS_FREQUENCY_TYPE poll_frequency )
+{
+	ENCODERS_DEGREE_TYPE expect_pos;
+	ENCODERS_DEGREE_TYPE expect_speed;
+	ENCODERS_DEGREE_TYPE last;
+	uint32_t index;
+	uint32_t sample;
+	unsigned failures = 0;
+	uint8_t counter;
+
+	encoders_convert( ticks, pos, speed, num_samples,
+			p_degrees_per_1000_tick, p_position_prev, poll_frequency );
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+	{
+		last = p_position_prev->val[counter];
+
+		for( sample = 0; sample < num_samples; sample++ )
+		{
+			index = counter * num_samples + sample;
+			expect_pos = test_reference( ticks[index],
+					p_degrees_per_1000_tick->val[counter] );
+			expect_speed = (expect_pos - last) * poll_frequency;
+			last = expect_pos;
+
+			if( memcmp(&expect_pos, &pos[index], sizeof(expect_pos)) ||
+					memcmp(&expect_speed, &speed[index], sizeof(expect_speed)) )
+			{
+				if( failures++ < 10 )
+					printf("mismatch: samples %u joint %u sample %u ticks %u\n",
+							(unsigned) num_samples, (unsigned) counter,
+							(unsigned) sample, (unsigned) ticks[index]);
+			}
+		}
+	}
+
+	return failures;
+}
+
+int main( void )
+{
+	encoders_array_degrees_t degrees_per_1000_tick = {
+			{ 0.1f, 0.37f, 1.0f, -2.5f, 1e-3f, 360.0f / 4096.0f } };
+	encoders_array_degrees_t position_prev = {
+			{ 0.0f, 3.0f, -7.25f, 1e6f, 0.5f, 12.0f } };
+	uint32_t num_samples;
+	uint32_t index;
+	unsigned failures = 0;
+	unsigned batches = 0;
+
+	for( num_samples = 1; num_samples <= TEST_MAX_SAMPLES;
+			num_samples += (num_samples < 40) ? 1 : 333 )
+	{
+		for( index = 0; index < ENCODERS_NUM_JOINTS * num_samples; index++ )
+		{
+			ticks[index] = (test_random() & 1) ?
+					edges[index % (sizeof(edges) / sizeof(edges[0]))] :
+					test_random();
+		}
+
+		failures += test_batch( num_samples, &degrees_per_1000_tick,
+				&position_prev, 1000.0f );
+		failures += test_batch( num_samples, &degrees_per_1000_tick,
+				&position_prev, 333.3f );
+		batches += 2;
+	}
+
+	printf("%s: %u batches, %u mismatches\n",
+			failures ? "FAIL" : "PASS", batches, failures);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,490 @@
+/* ******************************************************
+ * @file test_encoders.c
+ * @brief Exercises encoders_poll against mocked LS7366R chips
+ *
+ * Build and run from the repository root:
+ * 		cc -O2 -Wall -I. test/test_encoders.c encoders.c ls7366r.c -o test_encoders && ./test_encoders
+ * 		cc -O2 -Wall -DENCODERS_WCET=1 -I. test/test_encoders.c encoders.c ls7366r.c -o test_encoders && ./test_encoders
+ ********************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "encoders.h"
+#include "ls7366r.h"
+#include "test_mock.h"
+
+#define TEST_FREQUENCY	(1000.0f)
+#define TEST_MAX_SPEED	(1000.0f)	/* 1000 ticks per poll at 1 degree per 1000 ticks */
+
+static uint8_t mock_lock_busy;
+static uint8_t mock_inject_preload;		/* preload on the next lock acquisition */
+static uint8_t mock_inject_preload_bus;	/* preload after this many more transactions */
+static encoders_array_degrees_t mock_preload_pos;
+
+/*
+ * Runs a preload between two transactions of a poll,
+ * the only point a real bus lock lets it in
+ */
+static void mock_bus_inject( void )
+{
+	if( mock_inject_preload_bus && !--mock_inject_preload_bus )
+		encoders_set_position_abs( &mock_preload_pos );
+}
+
+/*
+ * Mocked lock, can run a preload between the counter reads
+ * of a poll and its lock acquisition
+ */
+static void mock_lock_inject( void )
+{
+	if( mock_inject_preload )
+	{
+		mock_inject_preload = 0;
+		encoders_set_position_abs( &mock_preload_pos );
+	}
+}
+
+void _encoders_lock_global( void )
+{
+	mock_lock_inject();
+}
+
+void _encoders_unlock_global( void )
+{
+}
+
+uint8_t _encoders_trylock_global( void )
+{
+	if( mock_lock_busy )
+		return 0;
+
+	mock_lock_inject();
+	return 1;
+}
+
+static void test_init_scale( ENCODERS_DEGREE_TYPE scale )
+{
+	encoders_array_degrees_t degrees_per_1000_tick;
+	static const encoders_array_degrees_t position_ref = { { 0 } };
+	static const encoders_array_degrees_t max_speed = { {
+			TEST_MAX_SPEED, TEST_MAX_SPEED, TEST_MAX_SPEED,
+			TEST_MAX_SPEED, TEST_MAX_SPEED, TEST_MAX_SPEED } };
+	encoders_init_t init;
+	uint8_t counter;
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		degrees_per_1000_tick.val[counter] = scale;
+
+	mock_lock_busy = 0;
+	mock_inject_preload = 0;
+	mock_inject_preload_bus = 0;
+	mock_on_bus_unlock = mock_bus_inject;
+	memset( mock_stuck, 0, sizeof(mock_stuck) );
+	memset( mock_corrupt_once, 0, sizeof(mock_corrupt_once) );
+
+	init.poll_frequency = TEST_FREQUENCY;
+	init.p_degrees_per_1000_tick = &degrees_per_1000_tick;
+	init.p_position_ref = &position_ref;
+	encoders_init( &init );
+	encoders_set_max_speed( &max_speed );
+}
+
+static void test_init( void )
+{
+	test_init_scale( 1 );
+}
+
+static void test_step( uint32_t ticks )
+{
+	uint8_t counter;
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		mock_counter[counter] += ticks;
+}
+
+/* every joint at its declared maximum speed must not fault */
+static void test_max_speed( void )
+{
+	encoders_array_degrees_t speed;
+	int poll;
+
+	test_init();
+
+	for( poll = 0; poll < 20; poll++ )
+	{
+		test_step( 1001 );
+		encoders_poll();
+	}
+
+	encoders_get_speed( &speed );
+	TEST_CHECK( encoders_get_faults() == 0 );
+	TEST_CHECK( speed.val[0] > 0 && speed.val[0] <= 2 * TEST_MAX_SPEED );
+}
+
+/* a single corrupted read is re-read and never published */
+static void test_single_glitch( void )
+{
+	encoders_array_degrees_t pos;
+	encoders_array_degrees_t speed;
+	int poll;
+
+	test_init();
+
+	for( poll = 0; poll < 10; poll++ )
+	{
+		test_step( 1000 );
+		mock_corrupt_once[2] = (poll == 5) ? 0x40 : 0;
+		encoders_poll();
+
+		encoders_get_speed( &speed );
+		TEST_CHECK( speed.val[2] == TEST_MAX_SPEED );
+	}
+
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( pos.val[2] == 10 );
+	TEST_CHECK( encoders_get_faults() == 0 );
+}
+
+/* a stuck MISO bit faults the joint without ever publishing a spike */
+static void test_stuck_bit( void )
+{
+	encoders_array_degrees_t pos;
+	encoders_array_degrees_t speed;
+	uint32_t reads;
+	int poll;
+
+	test_init();
+
+	for( poll = 0; poll < 3; poll++ )
+	{
+		test_step( 1000 );
+		encoders_poll();
+	}
+
+	mock_stuck[0] = 0x40;
+
+	for( poll = 0; poll < 10; poll++ )
+	{
+		test_step( 1000 );
+		encoders_poll();
+
+		encoders_get_position_abs( &pos );
+		encoders_get_speed( &speed );
+		TEST_CHECK( pos.val[0] <= 3 + ENCODERS_GLITCH_LIMIT );
+		TEST_CHECK( speed.val[0] >= 0 && speed.val[0] <= TEST_MAX_SPEED );
+	}
+
+	/* held at the last accepted position with zero speed */
+	TEST_CHECK( encoders_get_faults() == 1 );
+	TEST_CHECK( speed.val[0] == 0 );
+	TEST_CHECK( speed.val[1] == TEST_MAX_SPEED );
+
+	/* a faulted joint is read once per poll, never re-read */
+	reads = mock_reads[0];
+
+	for( poll = 0; poll < 10; poll++ )
+	{
+		test_step( 1000 );
+		encoders_poll();
+	}
+
+	TEST_CHECK( mock_reads[0] - reads == 10 );
+	TEST_CHECK( encoders_get_faults() == 1 );
+
+	/* still held while the fault is flagged, even with a good bus */
+	mock_stuck[0] = 0;
+	test_step( 1000 );
+	encoders_poll();
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( pos.val[0] <= 3 + ENCODERS_GLITCH_LIMIT );
+
+	/* clearing resynchronizes to the counter at zero speed */
+	encoders_clear_faults( 1 );
+	test_step( 1000 );
+	encoders_poll();
+	encoders_get_position_abs( &pos );
+	encoders_get_speed( &speed );
+	TEST_CHECK( pos.val[0] == mock_counter[0] / 1000 );
+	TEST_CHECK( speed.val[0] == 0 );
+	TEST_CHECK( encoders_get_faults() == 0 );
+
+	test_step( 1000 );
+	encoders_poll();
+	encoders_get_speed( &speed );
+	TEST_CHECK( speed.val[0] == TEST_MAX_SPEED );
+	TEST_CHECK( encoders_get_faults() == 0 );
+}
+
+/* preload rounds to the nearest tick and saturates */
+static void test_preload_rounding( void )
+{
+	encoders_array_degrees_t target;
+	encoders_array_degrees_t pos;
+	volatile ENCODERS_DEGREE_TYPE zero = 0;
+
+	test_init_scale( 0.1f );
+
+	target.val[0] = 123.456f;
+	target.val[1] = -123.456f;
+	target.val[2] = 1e12f;
+	target.val[3] = -1e12f;
+	target.val[4] = zero / zero;
+	target.val[5] = 0.04f;
+	encoders_set_position_abs( &target );
+
+	TEST_CHECK( mock_counter[0] == 1234560 );
+	TEST_CHECK( mock_counter[1] == 0 );
+	TEST_CHECK( mock_counter[2] == 0xFFFFFFFFu );
+	TEST_CHECK( mock_counter[3] == 0 );
+	TEST_CHECK( mock_counter[4] == 0 );
+	TEST_CHECK( mock_counter[5] == 400 );
+
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( pos.val[0] == 1234 * 0.1f );
+	TEST_CHECK( pos.val[1] == 0 );
+	TEST_CHECK( pos.val[2] == 4294967 * 0.1f );
+	TEST_CHECK( pos.val[3] == 0 );
+}
+
+/* the published position agrees with the preload over the whole counter range */
+static void test_preload_position( void )
+{
+	encoders_array_degrees_t target;
+	encoders_array_degrees_t pos;
+
+	test_init_scale( 0.1f );
+
+	target.val[0] = -10;
+	target.val[1] = 0;
+	target.val[2] = 10;
+	target.val[3] = 250000;		/* 2.5e9 ticks, above the signed range */
+	target.val[4] = 429000;
+	target.val[5] = 429500;		/* beyond the counter, saturates */
+	encoders_set_position_abs( &target );
+
+	/* published right after the preload and after the next polls */
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( pos.val[0] == 0 );
+	TEST_CHECK( pos.val[1] == 0 );
+	TEST_CHECK( pos.val[2] == 10 );
+	TEST_CHECK( mock_counter[3] == 2500000000u );
+	TEST_CHECK( pos.val[3] == 2500000 * 0.1f );
+	TEST_CHECK( mock_counter[4] > 0x80000000u );
+	TEST_CHECK( pos.val[4] == mock_counter[4] / 1000 * 0.1f );
+	TEST_CHECK( pos.val[4] > 428999 );
+	TEST_CHECK( mock_counter[5] == 0xFFFFFFFFu );
+	TEST_CHECK( pos.val[5] == 4294967 * 0.1f );
+
+	encoders_poll();
+	encoders_poll();
+
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( pos.val[0] == 0 );
+	TEST_CHECK( pos.val[3] == 2500000 * 0.1f );
+	TEST_CHECK( encoders_get_faults() == 0 );
+
+	encoders_get_position_rel( &pos );
+	TEST_CHECK( pos.val[0] == 0 );
+	TEST_CHECK( pos.val[2] == 10 );
+}
+
+/* a poll that read the counters before a preload discards its sample */
+static void test_preload_straddle( void )
+{
+	encoders_array_degrees_t pos;
+	encoders_array_degrees_t speed;
+	uint8_t counter;
+	int poll;
+
+	test_init();
+
+	for( poll = 0; poll < 3; poll++ )
+	{
+		test_step( 1000 );
+		encoders_poll();
+	}
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		mock_preload_pos.val[counter] = 500;
+
+	test_step( 1000 );
+	mock_inject_preload = 1;
+	encoders_poll();
+
+	encoders_get_position_abs( &pos );
+	encoders_get_speed( &speed );
+	TEST_CHECK( !mock_inject_preload );
+	TEST_CHECK( pos.val[0] == 500 );
+	TEST_CHECK( speed.val[0] == TEST_MAX_SPEED );
+
+	test_step( 1000 );
+	encoders_poll();
+
+	encoders_get_position_abs( &pos );
+	encoders_get_speed( &speed );
+	TEST_CHECK( pos.val[0] == 501 );
+	TEST_CHECK( speed.val[0] == TEST_MAX_SPEED );
+	TEST_CHECK( encoders_get_faults() == 0 );
+}
+
+/* a preload interleaved with the counter reads of a poll */
+static void test_preload_interleaved( void )
+{
+	encoders_array_degrees_t pos;
+	encoders_array_degrees_t speed;
+	uint8_t counter;
+	int poll;
+
+	test_init();
+	mock_bus_errors = 0;
+
+	for( poll = 0; poll < 3; poll++ )
+	{
+		test_step( 1000 );
+		encoders_poll();
+	}
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		mock_preload_pos.val[counter] = 500;
+
+	/* half of the joints are read before the preload, half after */
+	test_step( 1000 );
+	mock_inject_preload_bus = ENCODERS_NUM_JOINTS / 2;
+	encoders_poll();
+
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( !mock_inject_preload_bus );
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+		TEST_CHECK( pos.val[counter] == 500 );
+
+	test_step( 1000 );
+	encoders_poll();
+
+	encoders_get_position_abs( &pos );
+	encoders_get_speed( &speed );
+
+	for( counter = 0; counter < ENCODERS_NUM_JOINTS; counter++ )
+	{
+		TEST_CHECK( pos.val[counter] == 501 );
+		TEST_CHECK( speed.val[counter] == TEST_MAX_SPEED );
+	}
+
+	TEST_CHECK( encoders_get_faults() == 0 );
+	TEST_CHECK( !mock_bus_locked && mock_bus_errors == 0 );
+}
+
+#if ENCODERS_WCET
+/* polls dropped on a busy lock scale speed and glitch bound */
+static void test_busy_lock( void )
+{
+	encoders_array_degrees_t pos;
+	encoders_array_degrees_t speed;
+	int poll;
+
+	test_init();
+
+	for( poll = 0; poll < 12; poll++ )
+	{
+		test_step( 1000 );
+		mock_lock_busy = (poll % 3) != 0;
+		encoders_poll();
+
+		encoders_get_speed( &speed );
+		TEST_CHECK( speed.val[0] == TEST_MAX_SPEED );
+	}
+
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( pos.val[0] == 10 );
+	TEST_CHECK( encoders_get_faults() == 0 );
+}
+
+/* a lock that stays busy delays the snapshot by a bounded number of polls */
+static void test_busy_lock_stale( void )
+{
+	encoders_array_degrees_t pos;
+	encoders_array_degrees_t speed;
+	int poll;
+
+	test_init();
+
+	for( poll = 0; poll < 3; poll++ )
+	{
+		test_step( 1000 );
+		encoders_poll();
+	}
+
+	mock_lock_busy = 1;
+
+	for( poll = 0; poll < ENCODERS_WCET_MAX_MISSED; poll++ )
+	{
+		test_step( 1000 );
+		encoders_poll();
+
+		encoders_get_position_abs( &pos );
+		TEST_CHECK( pos.val[0] == 3 );
+	}
+
+	/* waits on the lock instead of dropping another sample */
+	test_step( 1000 );
+	encoders_poll();
+
+	encoders_get_position_abs( &pos );
+	encoders_get_speed( &speed );
+	TEST_CHECK( pos.val[0] == 3 + ENCODERS_WCET_MAX_MISSED + 1 );
+	TEST_CHECK( speed.val[0] == TEST_MAX_SPEED );
+	TEST_CHECK( encoders_get_faults() == 0 );
+
+	/* the count restarts after a published poll */
+	test_step( 1000 );
+	encoders_poll();
+
+	encoders_get_position_abs( &pos );
+	TEST_CHECK( pos.val[0] == 3 + ENCODERS_WCET_MAX_MISSED + 1 );
+}
+
+/* a fault is never lost when its polls hit a busy lock */
+static void test_busy_lock_fault( void )
+{
+	encoders_array_degrees_t speed;
+	int poll;
+
+	test_init();
+	mock_stuck[3] = 0x40;
+
+	for( poll = 0; poll < 4 * ENCODERS_GLITCH_LIMIT; poll++ )
+	{
+		test_step( 1000 );
+		mock_lock_busy = (poll % 2) != 0;
+		encoders_poll();
+
+		mock_lock_busy = 0;
+		encoders_get_speed( &speed );
+		TEST_CHECK( speed.val[3] >= 0 && speed.val[3] <= TEST_MAX_SPEED );
+	}
+
+	TEST_CHECK( encoders_get_faults() == (1 << 3) );
+	TEST_CHECK( speed.val[3] == 0 );
+}
+#endif
+
+int main( void )
+{
+	test_max_speed();
+	test_single_glitch();
+	test_stuck_bit();
+	test_preload_rounding();
+	test_preload_position();
+	test_preload_straddle();
+	test_preload_interleaved();
+#if ENCODERS_WCET
+	test_busy_lock();
+	test_busy_lock_stale();
+	test_busy_lock_fault();
+#endif
+
+	TEST_CHECK( !mock_bus_locked && mock_bus_errors == 0 );
+
+	printf("%s: %u failed checks\n", test_failures ? "FAIL" : "PASS", test_failures);
+
+	return test_failures ? 1 : 0;
+}
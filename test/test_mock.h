@@ -0,0 +1,116 @@
+/* ******************************************************
+ * @file test_mock.h
+ * @brief Mocked LS7366R chips and checks shared by the host programs
+ *
+ * Defines the _ls7366r_* bus hooks, so include it from exactly one
+ * source file per program.
+ ********************************************************/
+
+#ifndef HF7CBE3F8_6D68_4E9D_A6D8_AD8E2F73889C
+#define HF7CBE3F8_6D68_4E9D_A6D8_AD8E2F73889C
+
+#include <stdio.h>
+#include "encoders.h"
+#include "ls7366r.h"
+
+/*
+ * Checks
+ */
+unsigned test_failures;
+
+#define TEST_CHECK( cond ) \
+	do { \
+		if( !(cond) ) \
+		{ \
+			test_failures++; \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while( 0 )
+
+/*
+ * Mocked chips, counters start at zero
+ */
+static uint32_t mock_counter[ENCODERS_NUM_JOINTS];
+static uint32_t mock_data[ENCODERS_NUM_JOINTS];
+static uint8_t mock_cmd[ENCODERS_NUM_JOINTS];
+static uint8_t mock_byte[ENCODERS_NUM_JOINTS];
+static uint8_t mock_stuck[ENCODERS_NUM_JOINTS];		/* OR-ed into the MSB of every read */
+static uint8_t mock_corrupt_once[ENCODERS_NUM_JOINTS];	/* OR-ed into the MSB of the next read */
+static uint32_t mock_reads[ENCODERS_NUM_JOINTS];		/* counter reads */
+
+static uint8_t mock_bus_locked;
+static unsigned mock_bus_errors;		/* transfers outside, or nested, bus locks */
+
+/* called after every transaction, with the bus unlocked */
+static void (*mock_on_bus_unlock)( void );
+
+void _ls7366r_bus_lock( uint8_t chip_sel )
+{
+	(void) chip_sel;
+
+	mock_bus_errors += mock_bus_locked;
+	mock_bus_locked = 1;
+}
+
+void _ls7366r_bus_unlock( uint8_t chip_sel )
+{
+	(void) chip_sel;
+
+	mock_bus_errors += !mock_bus_locked;
+	mock_bus_locked = 0;
+
+	if( mock_on_bus_unlock )
+		mock_on_bus_unlock();
+}
+
+void _ls7366r_chip_sel( uint8_t chip_sel )
+{
+	mock_bus_errors += !mock_bus_locked;
+	mock_byte[chip_sel] = 0;
+}
+
+void _ls7366r_chip_desel( uint8_t chip_sel )
+{
+	(void) chip_sel;
+}
+
+uint8_t _ls7366r_spi_transfer( uint8_t chip_sel, uint8_t out )
+{
+	uint8_t index = mock_byte[chip_sel]++;
+	uint8_t ret;
+
+	mock_bus_errors += !mock_bus_locked;
+
+	if( index == 0 )
+	{
+		mock_cmd[chip_sel] = out;
+		mock_reads[chip_sel] += (out == _LS7366R_CMD_READ_CNTR_OTR);
+
+		if( out == _LS7366R_CMD_WRITE_DTR )
+			mock_data[chip_sel] = 0;
+		else if( out == _LS7366R_CMD_LOAD_DTR_CNTR )
+			mock_counter[chip_sel] = mock_data[chip_sel];
+		else if( out == _LS7366R_CMD_CLEAR_CNTR )
+			mock_counter[chip_sel] = 0;
+
+		return 0;
+	}
+
+	if( mock_cmd[chip_sel] == _LS7366R_CMD_WRITE_DTR )
+	{
+		mock_data[chip_sel] = (mock_data[chip_sel] << 8) | out;
+		return 0;
+	}
+
+	ret = (uint8_t)(mock_counter[chip_sel] >> (8 * (4 - index)));
+
+	if( index == 1 )
+	{
+		ret |= mock_stuck[chip_sel] | mock_corrupt_once[chip_sel];
+		mock_corrupt_once[chip_sel] = 0;
+	}
+
+	return ret;
+}
+
+#endif /* HF7CBE3F8_6D68_4E9D_A6D8_AD8E2F73889C */
@@ -0,0 +1,149 @@
+/* ******************************************************
+ * @file test_trace.c
+ * @brief Checks the reference trace hooks and JSON export
+ *
+ * Build and run from the repository root:
+ * 		cc -O2 -Wall -pthread -DLS7366R_TRACE=1 -DENCODERS_TRACE=1 -I. test/test_trace.c trace/encoders_trace.c encoders.c ls7366r.c -o test_trace && ./test_trace
+ * 		cc -O1 -g -Wall -fsanitize=thread -pthread -DLS7366R_TRACE=1 -DENCODERS_TRACE=1 -I. test/test_trace.c trace/encoders_trace.c encoders.c ls7366r.c -o test_trace && ./test_trace
+ ********************************************************/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encoders.h"
+#include "trace/encoders_trace.h"
+#include "test_mock.h"
+
+#define TEST_POLLS		(10)
+#define TEST_READS		(10)
+
+static int test_stop;
+
+static void *test_reader( void *p_arg )
+{
+	encoders_array_degrees_t speed;
+	int read;
+
+	(void) p_arg;
+
+	for( read = 0; read < TEST_READS; read++ )
+		encoders_get_speed( &speed );
+
+	return NULL;
+}
+
+static void *test_spinner( void *p_arg )
+{
+	encoders_array_degrees_t speed;
+
+	(void) p_arg;
+
+	while( !__atomic_load_n( &test_stop, __ATOMIC_RELAXED ) )
+		encoders_get_speed( &speed );
+
+	return NULL;
+}
+
+static unsigned test_count( const char *p_text, const char *p_pattern )
+{
+	unsigned count = 0;
+
+	while( (p_text = strstr( p_text, p_pattern )) != NULL )
+	{
+		count++;
+		p_text++;
+	}
+
+	return count;
+}
+
+/* exports a trace and returns it as a string */
+static char *test_export( long *p_count )
+{
+	FILE *p_file = tmpfile();
+	char *p_text;
+	long size;
+
+	if( !p_file )
+		return NULL;
+
+	*p_count = encoders_trace_export_json( p_file );
+	size = ftell( p_file );
+	rewind( p_file );
+
+	p_text = calloc( 1, (size_t) size + 1 );
+
+	if( p_text && fread( p_text, 1, (size_t) size, p_file ) != (size_t) size )
+	{
+		free( p_text );
+		p_text = NULL;
+	}
+
+	fclose( p_file );
+	return p_text;
+}
+
+int main( void )
+{
+	static const encoders_array_degrees_t degrees_per_1000_tick =
+			{ { 1, 1, 1, 1, 1, 1 } };
+	static const encoders_array_degrees_t position_ref = { { 0 } };
+	encoders_init_t init;
+	pthread_t thread;
+	char *p_text;
+	long count;
+	int poll;
+
+	init.poll_frequency = 1000;
+	init.p_degrees_per_1000_tick = &degrees_per_1000_tick;
+	init.p_position_ref = &position_ref;
+	encoders_init( &init );
+
+	for( poll = 0; poll < TEST_POLLS; poll++ )
+		encoders_poll();
+
+	pthread_create( &thread, NULL, test_reader, NULL );
+	pthread_join( thread, NULL );
+
+	p_text = test_export( &count );
+	TEST_CHECK( p_text != NULL );
+
+	if( p_text )
+	{
+		/*
+		 * init: 1 lock, 3 transactions and 5 bytes per chip
+		 * poll: 1 lock, 1 transaction and 5 bytes per chip
+		 * reader: 1 lock per read
+		 */
+		TEST_CHECK( strncmp( p_text, "{\"traceEvents\":[", 16 ) == 0 );
+		TEST_CHECK( test_count( p_text, "\"thread_name\"" ) == 2 );
+		TEST_CHECK( test_count( p_text, "\"name\":\"lock\"" ) ==
+				1 + TEST_POLLS + TEST_READS );
+		TEST_CHECK( test_count( p_text, "\"cat\":\"spi\",\"ph\":\"E\"" ) ==
+				ENCODERS_NUM_JOINTS * (3 + TEST_POLLS) );
+		TEST_CHECK( test_count( p_text, "\"name\":\"transfer\"" ) ==
+				ENCODERS_NUM_JOINTS * 5 * (1 + TEST_POLLS) );
+		TEST_CHECK( test_count( p_text, "\"ph\":\"B\"" ) ==
+				test_count( p_text, "\"ph\":\"E\"" ) );
+		TEST_CHECK( count == (long) test_count( p_text, "\"ph\":" ) -
+				test_count( p_text, "\"ph\":\"M\"" ) );
+		free( p_text );
+	}
+
+	/* export while another thread keeps overwriting its buffer */
+	pthread_create( &thread, NULL, test_spinner, NULL );
+
+	for( poll = 0; poll < 100; poll++ )
+	{
+		p_text = test_export( &count );
+		TEST_CHECK( p_text != NULL && count > 0 );
+		free( p_text );
+	}
+
+	__atomic_store_n( &test_stop, 1, __ATOMIC_RELAXED );
+	pthread_join( thread, NULL );
+
+	printf("%s: %u failed checks\n", test_failures ? "FAIL" : "PASS", test_failures);
+
+	return test_failures ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+/* ******************************************************
+ * @file encoders_trace.c
+ * @brief Reference trace hooks for the encoders and LS7366R drivers
+ ********************************************************/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "encoders.h"
+#include "ls7366r.h"
+#include "encoders_trace.h"
+
+#if ENCODERS_TRACE_BUFFER_SIZE & (ENCODERS_TRACE_BUFFER_SIZE - 1)
+#error "ENCODERS_TRACE_BUFFER_SIZE must be a power of two"
+#endif
+
+#define TRACE_SOURCE_LS7366R	(0)
+#define TRACE_SOURCE_ENCODERS	(1)
+
+/*
+ * seq is the record index plus one once the record is complete and
+ * zero while it is written, a seqlock per slot. Fields are accessed
+ * with atomics only so that the exporter can copy them concurrently.
+ */
+typedef struct {
+	uint32_t seq;
+	uint64_t timestamp;	/* CLOCK_MONOTONIC in ns */
+	uint8_t source;
+	uint8_t event;
+	uint8_t chip_sel;
+	uint8_t arg;
+} trace_record_t;
+
+/*
+ * One buffer per thread, written only by its thread.
+ * Buffers are never freed.
+ */
+typedef struct trace_buffer {
+	struct trace_buffer *p_next;
+	uint32_t tid;
+	uint32_t head;
+	trace_record_t records[ENCODERS_TRACE_BUFFER_SIZE];
+} trace_buffer_t;
+
+static trace_buffer_t *p_trace_buffers;
+static uint32_t trace_next_tid;
+static __thread trace_buffer_t *p_trace_local;
+
+static uint64_t trace_now( void )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+/*
+ * Returns the buffer of the calling thread,
+ * allocated and registered on first use
+ */
+static trace_buffer_t *trace_local( void )
+{
+	trace_buffer_t *p_buffer = p_trace_local;
+
+	if( p_buffer )
+		return p_buffer;
+
+	p_buffer = calloc( 1, sizeof(trace_buffer_t) );
+
+	if( !p_buffer )
+		return NULL;
+
+	p_buffer->tid = __atomic_add_fetch( &trace_next_tid, 1, __ATOMIC_RELAXED );
+	p_buffer->p_next = __atomic_load_n( &p_trace_buffers, __ATOMIC_RELAXED );
+
+	/* lock-free push onto the list of buffers */
+	while( !__atomic_compare_exchange_n( &p_trace_buffers, &p_buffer->p_next,
+			p_buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+		;
+
+	p_trace_local = p_buffer;
+	return p_buffer;
+}
+
+static void trace_record( uint8_t source, uint8_t event,
+		uint8_t chip_sel, uint8_t arg )
+{
+	trace_buffer_t *p_buffer = trace_local();
+	trace_record_t *p_record;
+	uint32_t head;
+
+	if( !p_buffer )
+		return;
+
+	head = __atomic_load_n( &p_buffer->head, __ATOMIC_RELAXED );
+	p_record = &p_buffer->records[head & (ENCODERS_TRACE_BUFFER_SIZE - 1)];
+
+	/*
+	 * release stores keep the fields from becoming visible
+	 * before the slot is marked as being written
+	 */
+	__atomic_store_n( &p_record->seq, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &p_record->timestamp, trace_now(), __ATOMIC_RELEASE );
+	__atomic_store_n( &p_record->source, source, __ATOMIC_RELEASE );
+	__atomic_store_n( &p_record->event, event, __ATOMIC_RELEASE );
+	__atomic_store_n( &p_record->chip_sel, chip_sel, __ATOMIC_RELEASE );
+	__atomic_store_n( &p_record->arg, arg, __ATOMIC_RELEASE );
+	__atomic_store_n( &p_record->seq, head + 1, __ATOMIC_RELEASE );
+
+	__atomic_store_n( &p_buffer->head, head + 1, __ATOMIC_RELEASE );
+}
+
+/*
+ * Copies the record with the given index, returns 0 if the
+ * owner overwrote it or was writing it during the copy
+ */
+static int trace_copy( const trace_buffer_t *p_buffer, uint32_t index,
+		trace_record_t *p_copy )
+{
+	const trace_record_t *p_record =
+			&p_buffer->records[index & (ENCODERS_TRACE_BUFFER_SIZE - 1)];
+
+	if( __atomic_load_n( &p_record->seq, __ATOMIC_ACQUIRE ) != index + 1 )
+		return 0;
+
+	/* acquire loads keep the second seq load after the fields */
+	p_copy->timestamp = __atomic_load_n( &p_record->timestamp, __ATOMIC_ACQUIRE );
+	p_copy->source = __atomic_load_n( &p_record->source, __ATOMIC_ACQUIRE );
+	p_copy->event = __atomic_load_n( &p_record->event, __ATOMIC_ACQUIRE );
+	p_copy->chip_sel = __atomic_load_n( &p_record->chip_sel, __ATOMIC_ACQUIRE );
+	p_copy->arg = __atomic_load_n( &p_record->arg, __ATOMIC_ACQUIRE );
+
+	return __atomic_load_n( &p_record->seq, __ATOMIC_RELAXED ) == index + 1;
+}
+
+void _ls7366r_trace( uint8_t event, uint8_t chip_sel, uint8_t arg )
+{
+	trace_record( TRACE_SOURCE_LS7366R, event, chip_sel, arg );
+}
+
+void _encoders_trace( uint8_t event )
+{
+	trace_record( TRACE_SOURCE_ENCODERS, event, 0, 0 );
+}
+
+/*
+ * Writes one record as a trace event, returns
+ * the fprintf result
+ */
+static int trace_export_record( FILE *p_file, const char *p_separator,
+		long pid, uint32_t tid, const trace_record_t *p_record )
+{
+	double ts = (double) p_record->timestamp / 1000.0;
+
+	if( p_record->source == TRACE_SOURCE_LS7366R )
+	{
+		switch( p_record->event )
+		{
+		case LS7366R_TRACE_BEGIN:
+			return fprintf( p_file, "%s{\"name\":\"cmd 0x%02X\",\"cat\":\"spi\","
+					"\"ph\":\"B\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%u,"
+					"\"args\":{\"chip\":%u}}",
+					p_separator, p_record->arg, ts, pid, tid, p_record->chip_sel );
+
+		case LS7366R_TRACE_CHIP_SEL:
+			return fprintf( p_file, "%s{\"name\":\"chip_sel\",\"cat\":\"spi\","
+					"\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%u,"
+					"\"args\":{\"chip\":%u}}",
+					p_separator, ts, pid, tid, p_record->chip_sel );
+
+		case LS7366R_TRACE_TRANSFER:
+			return fprintf( p_file, "%s{\"name\":\"transfer\",\"cat\":\"spi\","
+					"\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%u,"
+					"\"args\":{\"chip\":%u,\"in\":%u}}",
+					p_separator, ts, pid, tid, p_record->chip_sel, p_record->arg );
+
+		case LS7366R_TRACE_CHIP_DESEL:
+			return fprintf( p_file, "%s{\"cat\":\"spi\",\"ph\":\"E\","
+					"\"ts\":%.3f,\"pid\":%ld,\"tid\":%u}",
+					p_separator, ts, pid, tid );
+		}
+	}
+	else
+	{
+		switch( p_record->event )
+		{
+		case ENCODERS_TRACE_LOCK_ACQUIRE:
+			return fprintf( p_file, "%s{\"name\":\"lock\",\"cat\":\"lock\","
+					"\"ph\":\"B\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%u}",
+					p_separator, ts, pid, tid );
+
+		case ENCODERS_TRACE_LOCK_RELEASE:
+			return fprintf( p_file, "%s{\"cat\":\"lock\",\"ph\":\"E\","
+					"\"ts\":%.3f,\"pid\":%ld,\"tid\":%u}",
+					p_separator, ts, pid, tid );
+
+		case ENCODERS_TRACE_LOCK_BUSY:
+			return fprintf( p_file, "%s{\"name\":\"lock busy\",\"cat\":\"lock\","
+					"\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%u}",
+					p_separator, ts, pid, tid );
+		}
+	}
+
+	/* unknown events are skipped */
+	return 0;
+}
+
+long encoders_trace_export_json( FILE *p_file )
+{
+	trace_buffer_t *p_buffer;
+	trace_record_t record;
+	const char *p_separator = "\n";
+	long pid = (long) getpid();
+	long count = 0;
+	uint32_t head;
+	uint32_t index;
+	int written;
+
+	if( fprintf( p_file, "{\"traceEvents\":[" ) < 0 )
+		return -1;
+
+	for( p_buffer = __atomic_load_n( &p_trace_buffers, __ATOMIC_ACQUIRE );
+			p_buffer; p_buffer = p_buffer->p_next )
+	{
+		head = __atomic_load_n( &p_buffer->head, __ATOMIC_ACQUIRE );
+		index = (head > ENCODERS_TRACE_BUFFER_SIZE) ?
+				head - ENCODERS_TRACE_BUFFER_SIZE : 0;
+
+		if( fprintf( p_file, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+				"\"pid\":%ld,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+				p_separator, pid, p_buffer->tid, p_buffer->tid ) < 0 )
+			return -1;
+
+		p_separator = ",\n";
+
+		for( ; index != head; index++ )
+		{
+			if( !trace_copy( p_buffer, index, &record ) )
+				continue;
+
+			written = trace_export_record( p_file, p_separator, pid,
+					p_buffer->tid, &record );
+
+			if( written < 0 )
+				return -1;
+
+			if( written > 0 )
+				count++;
+		}
+	}
+
+	if( fprintf( p_file, "\n]}\n" ) < 0 )
+		return -1;
+
+	return count;
+}
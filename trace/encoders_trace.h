@@ -0,0 +1,36 @@
+/* ******************************************************
+ * @file encoders_trace.h
+ * @brief Reference trace hooks for the encoders and LS7366R drivers
+ *
+ * Defines _ls7366r_trace and _encoders_trace over a per-thread
+ * lock-free ring buffer and exports the buffers as a Chrome trace
+ * event JSON file, which chrome://tracing and ui.perfetto.dev open.
+ *
+ * Compile the drivers with -DLS7366R_TRACE=1 -DENCODERS_TRACE=1 and
+ * link trace/encoders_trace.c. Needs POSIX clock_gettime and the
+ * GCC/Clang __atomic builtins, so it is meant for hosted targets.
+ ********************************************************/
+
+#ifndef H7F3C2A1E_5B4D_4E8A_9C61_2D0F8B7A3E54
+#define H7F3C2A1E_5B4D_4E8A_9C61_2D0F8B7A3E54
+
+#include <stdio.h>
+
+/*
+ * Events kept per thread, the oldest are overwritten
+ * when a buffer is full. Must be a power of two.
+ */
+#ifndef ENCODERS_TRACE_BUFFER_SIZE
+#define ENCODERS_TRACE_BUFFER_SIZE (4096)
+#endif
+
+/**
+ * @brief Writes every thread's buffer as a Chrome trace event JSON
+ * @param p_file writable file
+ * @return number of events written, or -1 on a write error
+ * @details Safe to call while other threads keep tracing. Events
+ * overwritten or being written during the export are skipped.
+ */
+long encoders_trace_export_json( FILE *p_file );
+
+#endif /* H7F3C2A1E_5B4D_4E8A_9C61_2D0F8B7A3E54 */